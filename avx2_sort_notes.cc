@@ -0,0 +1,558 @@
+// Notes on sorting small arrays with AVX2 sorting networks.
+//
+// A sorting network is a fixed sequence of compare-exchange
+// operations, so it has no data-dependent branches. With four int64
+// lanes per register, a compare-exchange of two registers is one
+// vpcmpgtq and two vpblendvb. The bitonic network (see [1]) is
+// regular enough to express for any power-of-two size: stages at
+// distance >= 4 pair whole registers, and the distance-2 and
+// distance-1 stages pair lanes inside a register with a vpermq.
+//
+// AVX2 only has a signed 64-bit comparison, so everything below sorts
+// int64_t keys. uint64_t maps to a key by flipping the sign bit, and
+// double maps to a key with double_key from ieee754_notes.cc. That map
+// is an involution, so key_double applies it again to map back.
+// Doubles then sort in the refined total order (-NaN < -inf < ... <
+// -0.0 < 0.0 < ... < inf < NaN).
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <x86intrin.h>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+template <typename To, typename From> To transmute(From x) {
+    static_assert(sizeof(To) == sizeof(From), "size mismatch");
+    To y;
+    memcpy(&y, &x, sizeof(y));
+    return y;
+}
+
+uint64_t asr(uint64_t x, uint32_t shift) {
+    return static_cast<int64_t>(x) >> shift;
+}
+
+int64_t double_key(double d) {
+    uint64_t x = transmute<uint64_t>(d);
+    return x ^ (asr(x, 63) >> 1);
+}
+
+double key_double(int64_t key) {
+    uint64_t x = key;
+    return transmute<double>(x ^ (asr(x, 63) >> 1));
+}
+
+template <typename T> struct KeyTraits;
+
+template <> struct KeyTraits<int64_t> {
+    static int64_t to_key(int64_t x) { return x; }
+    static int64_t from_key(int64_t k) { return k; }
+};
+
+template <> struct KeyTraits<uint64_t> {
+    static int64_t to_key(uint64_t x) { return x ^ 0x8000000000000000; }
+    static uint64_t from_key(int64_t k) { return k ^ 0x8000000000000000; }
+};
+
+template <> struct KeyTraits<double> {
+    static int64_t to_key(double x) { return double_key(x); }
+    static double from_key(int64_t k) { return key_double(k); }
+};
+
+const int64_t KEY_MAX = std::numeric_limits<int64_t>::max();
+
+// Compare-exchange: afterwards a holds the lane-wise minimum and b the
+// maximum.
+inline void compare_exchange(__m256i &a, __m256i &b) {
+    __m256i gt = _mm256_cmpgt_epi64(a, b);
+    __m256i lo = _mm256_blendv_epi8(a, b, gt);
+    b = _mm256_blendv_epi8(b, a, gt);
+    a = lo;
+}
+
+// One step of a bitonic network on the 4N elements of v, where element
+// e is lane e % 4 of v[e / 4]. Elements e and e ^ D are
+// compare-exchanged, with the smaller one moving to the lower index if
+// e lies in an ascending block of size Block and to the higher index
+// otherwise. Steps D/2, ..., 1 follow.
+template <size_t Block, size_t D, size_t N>
+inline void bitonic_step(__m256i (&v)[N]) {
+    if constexpr (D >= 4) {
+        constexpr size_t DR = D / 4;
+        for (size_t r = 0; r < N; ++r) {
+            if (r & DR)
+                continue;
+            if ((4 * r) & Block)
+                compare_exchange(v[r + DR], v[r]);
+            else
+                compare_exchange(v[r], v[r + DR]);
+        }
+    } else {
+        // Lane l takes the maximum if it is the upper element of its
+        // pair in an ascending block or the lower in a descending one.
+        for (size_t r = 0; r < N; ++r) {
+            auto take_max = [r](int64_t l) -> int64_t {
+                size_t e = 4 * r + l;
+                return ((e & D) != 0) == ((e & Block) == 0) ? -1 : 0;
+            };
+            __m256i mask = _mm256_setr_epi64x(take_max(0), take_max(1),
+                                              take_max(2), take_max(3));
+            __m256i p = D == 2 ? _mm256_permute4x64_epi64(v[r], 0x4e)
+                               : _mm256_permute4x64_epi64(v[r], 0xb1);
+            __m256i gt = _mm256_cmpgt_epi64(v[r], p);
+            __m256i lo = _mm256_blendv_epi8(v[r], p, gt);
+            __m256i hi = _mm256_blendv_epi8(p, v[r], gt);
+            v[r] = _mm256_blendv_epi8(lo, hi, mask);
+        }
+    }
+    if constexpr (D > 1)
+        bitonic_step<Block, D / 2>(v);
+}
+
+template <size_t Block, size_t N> inline void bitonic_stages(__m256i (&v)[N]) {
+    bitonic_step<Block, Block / 2>(v);
+    if constexpr (Block < 4 * N)
+        bitonic_stages<2 * Block>(v);
+}
+
+// Sort the 4N elements of v in ascending order.
+template <size_t N> inline void bitonic_sort(__m256i (&v)[N]) {
+    static_assert(N >= 1 && (N & (N - 1)) == 0, "N must be a power of two");
+    bitonic_stages<2>(v);
+}
+
+// Sort v, given that it is bitonic (ascending then descending).
+template <size_t N> inline void bitonic_merge(__m256i (&v)[N]) {
+    bitonic_step<4 * N, 2 * N>(v);
+}
+
+// Merge two sorted 8-element sequences, v[0..1] and v[2..3], into a
+// sorted 16-element sequence by reversing the second half and running
+// a bitonic merge.
+inline void merge16(__m256i (&v)[4]) {
+    __m256i t = _mm256_permute4x64_epi64(v[3], 0x1b);
+    v[3] = _mm256_permute4x64_epi64(v[2], 0x1b);
+    v[2] = t;
+    bitonic_merge(v);
+}
+
+// Lane mask of the first n - 4r elements of register r.
+inline __m256i lane_mask(size_t n, size_t r) {
+    int64_t remaining = static_cast<int64_t>(n) - static_cast<int64_t>(4 * r);
+    return _mm256_cmpgt_epi64(_mm256_set1_epi64x(remaining),
+                              _mm256_setr_epi64x(0, 1, 2, 3));
+}
+
+// Load n <= 4N keys, padding with KEY_MAX so that padding sorts last.
+template <size_t N>
+inline void load_padded(__m256i (&v)[N], const int64_t *p, size_t n) {
+    for (size_t r = 0; r < N; ++r) {
+        __m256i mask = lane_mask(n, r);
+        auto q = reinterpret_cast<const long long *>(p + std::min(4 * r, n));
+        v[r] = _mm256_blendv_epi8(_mm256_set1_epi64x(KEY_MAX),
+                                  _mm256_maskload_epi64(q, mask), mask);
+    }
+}
+
+template <size_t N>
+inline void store_partial(int64_t *p, const __m256i (&v)[N], size_t n) {
+    for (size_t r = 0; r < N; ++r)
+        _mm256_maskstore_epi64(
+            reinterpret_cast<long long *>(p + std::min(4 * r, n)),
+            lane_mask(n, r), v[r]);
+}
+
+template <size_t N> void network_sort_n(int64_t *p, size_t n) {
+    __m256i v[N];
+    load_padded(v, p, n);
+    bitonic_sort(v);
+    store_partial(p, v, n);
+}
+
+// Sort up to 64 keys in registers with an 8, 16, 32 or 64-element
+// network.
+void sort_small(int64_t *p, size_t n) {
+    assert(n <= 64);
+    if (n <= 8)
+        network_sort_n<2>(p, n);
+    else if (n <= 16)
+        network_sort_n<4>(p, n);
+    else if (n <= 32)
+        network_sort_n<8>(p, n);
+    else
+        network_sort_n<16>(p, n);
+}
+
+// Merge sorted a[0, na) and b[0, nb) into out. Eight keys at a time go
+// through merge16(): the lower half is final, and the upper half waits
+// for the next eight keys from whichever input has the smaller head
+// (see [2]). Once that input runs short, the remaining keys are merged
+// with scalar code.
+void merge_runs(const int64_t *a, size_t na, const int64_t *b, size_t nb,
+                int64_t *out) {
+    if (na < 8 || nb < 8) {
+        std::merge(a, a + na, b, b + nb, out);
+        return;
+    }
+    auto load = [](const int64_t *p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    };
+    __m256i v[4] = {load(a), load(a + 4), load(b), load(b + 4)};
+    a += 8, na -= 8, b += 8, nb -= 8;
+    for (;;) {
+        merge16(v);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), v[0]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 4), v[1]);
+        out += 8;
+        bool take_a = nb == 0 || (na != 0 && *a <= *b);
+        const int64_t *&src = take_a ? a : b;
+        size_t &remaining = take_a ? na : nb;
+        if (remaining < 8)
+            break;
+        v[0] = load(src);
+        v[1] = load(src + 4);
+        src += 8;
+        remaining -= 8;
+    }
+    int64_t hi[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(hi), v[2]);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(hi + 4), v[3]);
+    size_t nh = 0;
+    while (nh < 8 || na != 0 || nb != 0) {
+        int64_t h = nh < 8 ? hi[nh] : KEY_MAX;
+        if (na != 0 && *a <= h && (nb == 0 || *a <= *b))
+            *out++ = *a++, --na;
+        else if (nb != 0 && *b <= h)
+            *out++ = *b++, --nb;
+        else
+            *out++ = h, ++nh;
+    }
+}
+
+// Bottom-up mergesort with sort_small() as the base case.
+void network_mergesort(int64_t *data, size_t n) {
+    const size_t BASE = 64;
+    for (size_t i = 0; i < n; i += BASE)
+        sort_small(data + i, std::min(BASE, n - i));
+    if (n <= BASE)
+        return;
+    std::vector<int64_t> scratch(n);
+    int64_t *src = data;
+    int64_t *dst = scratch.data();
+    for (size_t width = BASE; width < n; width *= 2) {
+        for (size_t i = 0; i < n; i += 2 * width) {
+            size_t mid = std::min(i + width, n);
+            size_t end = std::min(i + 2 * width, n);
+            merge_runs(src + i, mid - i, src + mid, end - mid, dst + i);
+        }
+        std::swap(src, dst);
+    }
+    if (src != data)
+        std::copy(src, src + n, data);
+}
+
+template <typename T> void network_sort(T *data, size_t n) {
+    // Small sorts are the common case; keep them off the heap.
+    if (n <= 64) {
+        int64_t keys[64];
+        std::transform(data, data + n, keys, KeyTraits<T>::to_key);
+        sort_small(keys, n);
+        std::transform(keys, keys + n, data, KeyTraits<T>::from_key);
+        return;
+    }
+    std::vector<int64_t> keys(n);
+    std::transform(data, data + n, keys.begin(), KeyTraits<T>::to_key);
+    network_mergesort(keys.data(), n);
+    std::transform(keys.begin(), keys.end(), data, KeyTraits<T>::from_key);
+}
+
+// True if any of the n <= 64 keys at p is less than threshold.
+bool any_less(const int64_t *p, size_t n, int64_t threshold) {
+    __m256i v[16];
+    load_padded(v, p, n);
+    __m256i t = _mm256_set1_epi64x(threshold);
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t r = 0; r < 16; ++r)
+        acc = _mm256_or_si256(acc, _mm256_cmpgt_epi64(t, v[r]));
+    return !_mm256_testz_si256(acc, acc);
+}
+
+// The k smallest keys of data[0, n) under to_key, in ascending order.
+// Chunks of 64 keys are skipped with a vector comparison against the
+// current k-th key; the rest are sorted in registers and merged in.
+template <typename T, typename K>
+std::vector<int64_t> smallest_keys(const T *data, size_t n, size_t k,
+                                   const K &to_key) {
+    const size_t CHUNK = 64;
+    k = std::min(k, n);
+    std::vector<int64_t> best(k);
+    std::vector<int64_t> merged(k + CHUNK);
+    std::transform(data, data + k, best.begin(), to_key);
+    network_mergesort(best.data(), k);
+    int64_t chunk[CHUNK];
+    for (size_t i = k; k != 0 && i < n; i += CHUNK) {
+        size_t m = std::min(CHUNK, n - i);
+        std::transform(data + i, data + i + m, chunk, to_key);
+        if (!any_less(chunk, m, best[k - 1]))
+            continue;
+        sort_small(chunk, m);
+        merge_runs(best.data(), k, chunk, m, merged.data());
+        std::copy_n(merged.begin(), k, best.begin());
+    }
+    return best;
+}
+
+// Top-k selection: the k smallest (or largest) elements in order.
+// Complementing a key reverses the order.
+template <typename T>
+std::vector<T> smallest_k(const T *data, size_t n, size_t k) {
+    auto keys = smallest_keys(data, n, k, KeyTraits<T>::to_key);
+    std::vector<T> out(keys.size());
+    std::transform(keys.begin(), keys.end(), out.begin(),
+                   KeyTraits<T>::from_key);
+    return out;
+}
+
+template <typename T>
+std::vector<T> largest_k(const T *data, size_t n, size_t k) {
+    auto keys = smallest_keys(data, n, k,
+                              [](T x) { return ~KeyTraits<T>::to_key(x); });
+    std::vector<T> out(keys.size());
+    std::transform(keys.begin(), keys.end(), out.begin(),
+                   [](int64_t key) { return KeyTraits<T>::from_key(~key); });
+    return out;
+}
+
+// Random doubles drawn from raw bit patterns, so NaNs, infinities,
+// signed zeros and subnormals all show up, plus some duplicates.
+std::vector<double> random_doubles(std::default_random_engine &rng, size_t n) {
+    std::uniform_int_distribution<uint64_t> random_bits;
+    const double special[] = {0.0, -0.0, INFINITY, -INFINITY, NAN, -NAN, 1.0};
+    std::vector<double> out(n);
+    for (auto &x : out) {
+        uint64_t bits = random_bits(rng);
+        x = bits % 8 == 0 ? special[(bits >> 3) % 7] : transmute<double>(bits);
+    }
+    return out;
+}
+
+// Compare doubles by bit pattern so NaNs compare equal to themselves.
+std::vector<uint64_t> bits_of(const std::vector<double> &v) {
+    std::vector<uint64_t> out(v.size());
+    std::transform(v.begin(), v.end(), out.begin(),
+                   transmute<uint64_t, double>);
+    return out;
+}
+
+std::vector<double> sorted_by_key(std::vector<double> v) {
+    std::sort(v.begin(), v.end(), [](double a, double b) {
+        return double_key(a) < double_key(b);
+    });
+    return v;
+}
+
+template <typename F> double elapsed_ms(const F &f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+TEST(AVX2Sort, KeyRoundTrip) {
+    const double values[] = {0.0, -0.0, 1.0, -1.0, INFINITY, -INFINITY,
+                             NAN, -NAN, 0x1p-1074, -0x1p-1074};
+    for (double d : values)
+        ASSERT_EQ(transmute<uint64_t>(d),
+                  transmute<uint64_t>(key_double(double_key(d))));
+    ASSERT_LT(double_key(-0.0), double_key(0.0));
+    ASSERT_LT(KeyTraits<uint64_t>::to_key(1),
+              KeyTraits<uint64_t>::to_key(0x8000000000000000));
+}
+
+TEST(AVX2Sort, Networks) {
+    std::default_random_engine rng(1);
+    std::uniform_int_distribution<int64_t> random_key;
+    std::uniform_int_distribution<int64_t> small_key(-3, 3);
+    for (size_t n = 0; n <= 64; ++n) {
+        for (int iteration = 0; iteration < 100; ++iteration) {
+            std::vector<int64_t> v(n);
+            for (auto &x : v)
+                x = iteration % 2 ? random_key(rng) : small_key(rng);
+            if (iteration == 2 && n > 0)
+                v[0] = KEY_MAX; // real keys equal to the padding
+            std::vector<int64_t> expected = v;
+            std::sort(expected.begin(), expected.end());
+            sort_small(v.data(), n);
+            ASSERT_EQ(expected, v) << "n = " << n;
+        }
+    }
+}
+
+TEST(AVX2Sort, MergeRuns) {
+    std::default_random_engine rng(2);
+    std::uniform_int_distribution<int64_t> random_key(-1000, 1000);
+    for (size_t na : {0, 5, 8, 9, 31, 64, 200})
+        for (size_t nb : {0, 7, 8, 16, 33, 150}) {
+            std::vector<int64_t> a(na), b(nb), out(na + nb), expected(na + nb);
+            std::generate(a.begin(), a.end(), [&] { return random_key(rng); });
+            std::generate(b.begin(), b.end(), [&] { return random_key(rng); });
+            std::sort(a.begin(), a.end());
+            std::sort(b.begin(), b.end());
+            std::merge(a.begin(), a.end(), b.begin(), b.end(),
+                       expected.begin());
+            merge_runs(a.data(), na, b.data(), nb, out.data());
+            ASSERT_EQ(expected, out) << "na = " << na << ", nb = " << nb;
+        }
+}
+
+TEST(AVX2Sort, Mergesort) {
+    std::default_random_engine rng(3);
+    std::uniform_int_distribution<uint64_t> random_bits;
+    for (size_t n : {0, 1, 63, 64, 65, 100, 1000, 4096, 10007}) {
+        std::vector<uint64_t> u(n);
+        std::generate(u.begin(), u.end(), [&] { return random_bits(rng); });
+        std::vector<uint64_t> expected_u = u;
+        std::sort(expected_u.begin(), expected_u.end());
+        network_sort(u.data(), n);
+        ASSERT_EQ(expected_u, u) << "n = " << n;
+
+        std::vector<double> d = random_doubles(rng, n);
+        std::vector<double> expected_d = sorted_by_key(d);
+        network_sort(d.data(), n);
+        ASSERT_EQ(bits_of(expected_d), bits_of(d)) << "n = " << n;
+    }
+}
+
+TEST(AVX2Sort, TopK) {
+    std::default_random_engine rng(4);
+    std::uniform_int_distribution<uint64_t> random_bits;
+    const size_t N = 10000;
+    std::vector<uint64_t> u(N);
+    std::generate(u.begin(), u.end(), [&] { return random_bits(rng) % 5000; });
+    std::vector<double> d = random_doubles(rng, N);
+    std::vector<uint64_t> sorted_u = u;
+    std::sort(sorted_u.begin(), sorted_u.end());
+    std::vector<double> sorted_d = sorted_by_key(d);
+    for (size_t k : {size_t(0), size_t(1), size_t(10), size_t(64), size_t(100),
+                     size_t(1000), N, N + 1}) {
+        size_t kk = std::min(k, N);
+        std::vector<uint64_t> expected(sorted_u.begin(),
+                                       sorted_u.begin() + kk);
+        ASSERT_EQ(expected, smallest_k(u.data(), N, k)) << "k = " << k;
+        expected.assign(sorted_u.rbegin(), sorted_u.rbegin() + kk);
+        ASSERT_EQ(expected, largest_k(u.data(), N, k)) << "k = " << k;
+
+        std::vector<double> expected_d(sorted_d.begin(),
+                                       sorted_d.begin() + kk);
+        ASSERT_EQ(bits_of(expected_d), bits_of(smallest_k(d.data(), N, k)));
+        expected_d.assign(sorted_d.rbegin(), sorted_d.rbegin() + kk);
+        ASSERT_EQ(bits_of(expected_d), bits_of(largest_k(d.data(), N, k)));
+    }
+}
+
+// Many independent small sorts (the per-request case), then a few
+// medium ones.
+TEST(AVX2Sort, Benchmark) {
+    std::default_random_engine rng(5);
+    std::uniform_int_distribution<uint64_t> random_bits;
+    const size_t TOTAL = 1 << 20;
+    std::vector<uint64_t> input(TOTAL);
+    std::generate(input.begin(), input.end(), [&] { return random_bits(rng); });
+    std::vector<int64_t> keys(TOTAL);
+    std::transform(input.begin(), input.end(), keys.begin(),
+                   KeyTraits<uint64_t>::to_key);
+
+    for (size_t n : {8, 16, 32, 64}) {
+        std::vector<int64_t> expected = keys;
+        double std_ms = elapsed_ms([&] {
+            for (size_t i = 0; i < TOTAL; i += n)
+                std::sort(&expected[i], &expected[i] + n);
+        });
+        std::vector<int64_t> observed = keys;
+        double network_ms = elapsed_ms([&] {
+            for (size_t i = 0; i < TOTAL; i += n)
+                sort_small(&observed[i], n);
+        });
+        ASSERT_EQ(expected, observed);
+
+        // The same through network_sort(), including the key maps.
+        std::vector<uint64_t> observed_u = input;
+        double network_u_ms = elapsed_ms([&] {
+            for (size_t i = 0; i < TOTAL; i += n)
+                network_sort(&observed_u[i], n);
+        });
+        std::vector<uint64_t> expected_u = input;
+        for (size_t i = 0; i < TOTAL; i += n)
+            std::sort(&expected_u[i], &expected_u[i] + n);
+        ASSERT_EQ(expected_u, observed_u);
+
+        std::vector<double> expected_d = random_doubles(rng, TOTAL);
+        std::vector<double> observed_d = expected_d;
+        double std_double_ms = elapsed_ms([&] {
+            for (size_t i = 0; i < TOTAL; i += n)
+                std::sort(&expected_d[i], &expected_d[i] + n,
+                          [](double a, double b) {
+                              return double_key(a) < double_key(b);
+                          });
+        });
+        double network_double_ms = elapsed_ms([&] {
+            for (size_t i = 0; i < TOTAL; i += n)
+                network_sort(&observed_d[i], n);
+        });
+        ASSERT_EQ(bits_of(expected_d), bits_of(observed_d));
+        std::cout << TOTAL / n << " sorts of " << n << ": std::sort " << std_ms
+                  << " ms, network " << network_ms
+                  << " ms; network_sort uint64 " << network_u_ms
+                  << " ms; double: std::sort " << std_double_ms
+                  << " ms, network_sort " << network_double_ms << " ms"
+                  << std::endl;
+    }
+
+    for (size_t n : {1024, 65536, 1 << 20}) {
+        std::vector<uint64_t> expected(input.begin(), input.begin() + n);
+        std::vector<uint64_t> observed = expected;
+        double std_ms =
+            elapsed_ms([&] { std::sort(expected.begin(), expected.end()); });
+        double network_ms =
+            elapsed_ms([&] { network_sort(observed.data(), n); });
+        ASSERT_EQ(expected, observed);
+
+        std::vector<double> d = random_doubles(rng, n);
+        std::vector<double> expected_d = d;
+        std::vector<double> observed_d = d;
+        double std_double_ms = elapsed_ms([&] {
+            std::sort(expected_d.begin(), expected_d.end(),
+                      [](double a, double b) {
+                          return double_key(a) < double_key(b);
+                      });
+        });
+        double network_double_ms =
+            elapsed_ms([&] { network_sort(observed_d.data(), n); });
+        ASSERT_EQ(bits_of(expected_d), bits_of(observed_d));
+        std::cout << "sort of " << n << " uint64: std::sort " << std_ms
+                  << " ms, network mergesort " << network_ms
+                  << " ms; double: std::sort " << std_double_ms
+                  << " ms, network mergesort " << network_double_ms << " ms"
+                  << std::endl;
+    }
+}
+
+} // namespace
+
+// clang-format off
+// [1]: https://en.wikipedia.org/wiki/Bitonic_sorter
+// [2]: http://www.vldb.org/pvldb/vol8/p1274-inoue.pdf
+// clang-format on
@@ -1,8 +1,19 @@
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cinttypes>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <iostream>
 #include <random>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <x86intrin.h>
 
 namespace {
 
@@ -68,4 +79,346 @@ TEST(IEEE754Notes, RefinedOrder) {
     }
 }
 
+// double_key is an involution (it only flips the low 63 bits of
+// negative values, and leaves the sign bit alone), so the same map
+// takes a key back to its double:
+double key_double(int64_t key) {
+    uint64_t x = key;
+    return transmute<double>(x ^ (asr(x, 63) >> 1));
+}
+
+// Bulk classification and key extraction. One pass over the input
+// produces any of: the keys, a copy with NaNs canonicalized, and one
+// bitmap per class (bit i % 64 of word i / 64 is element i). The
+// classes describe the input values; with canonicalize set, the keys
+// and the copy use CANONICAL_NAN in place of every NaN, so that all
+// NaNs sort and hash alike.
+enum DoubleClass {
+    CLASS_NAN,
+    CLASS_INF,
+    CLASS_SUBNORMAL,
+    CLASS_ZERO,
+    CLASS_NEGATIVE,
+    NUM_CLASSES
+};
+
+const uint64_t CANONICAL_NAN = 0x7ff8000000000000;
+
+struct BulkOutput {
+    int64_t *keys = nullptr;
+    double *canonical = nullptr;
+    uint64_t *classes[NUM_CLASSES] = {};
+    bool canonicalize = false;
+
+    // The outputs for the elements starting at start, which must be a
+    // multiple of 64 so that bitmap words aren't shared.
+    BulkOutput offset(size_t start) const {
+        BulkOutput result = *this;
+        if (keys)
+            result.keys += start;
+        if (canonical)
+            result.canonical += start;
+        for (auto &c : result.classes)
+            if (c)
+                c += start / 64;
+        return result;
+    }
+};
+
+// Scalar version, written with the standard library's classification
+// functions.
+void bulk_classify_scalar(const double *in, size_t n, const BulkOutput &out) {
+    for (size_t i = 0; i < n; ++i) {
+        double x = in[i];
+        uint64_t bit = uint64_t(1) << (i % 64);
+        if (i % 64 == 0)
+            for (auto c : out.classes)
+                if (c)
+                    c[i / 64] = 0;
+        bool is_nan = std::isnan(x);
+        int fp_class = std::fpclassify(x);
+        bool flags[NUM_CLASSES] = {is_nan, fp_class == FP_INFINITE,
+                                   fp_class == FP_SUBNORMAL,
+                                   fp_class == FP_ZERO, std::signbit(x)};
+        for (size_t c = 0; c < NUM_CLASSES; ++c)
+            if (out.classes[c] && flags[c])
+                out.classes[c][i / 64] |= bit;
+        if (out.canonicalize && is_nan)
+            x = transmute<double>(CANONICAL_NAN);
+        if (out.keys)
+            out.keys[i] = double_key(x);
+        if (out.canonical)
+            out.canonical[i] = x;
+    }
+}
+
+// AVX2 version. Classes come from integer comparisons of the magnitude
+// bits against the exponent boundaries, and vmovmskpd turns each mask
+// into four bitmap bits. AVX2 has no 64-bit arithmetic shift, so the
+// sign mask for double_key is 0 > x instead of asr(x, 63). The last
+// partial register is read and written with masked loads and stores.
+void bulk_classify(const double *in, size_t n, const BulkOutput &out) {
+    const __m256i abs_mask = _mm256_set1_epi64x(0x7fffffffffffffff);
+    const __m256i inf_bits = _mm256_set1_epi64x(0x7ff0000000000000);
+    const __m256i min_normal = _mm256_set1_epi64x(0x0010000000000000);
+    const __m256i canonical = _mm256_set1_epi64x(CANONICAL_NAN);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lanes = _mm256_setr_epi64x(0, 1, 2, 3);
+    for (size_t base = 0; base < n; base += 64) {
+        uint64_t words[NUM_CLASSES] = {};
+        size_t m = std::min<size_t>(64, n - base);
+        for (size_t j = 0; j < m; j += 4) {
+            size_t i = base + j;
+            bool full = j + 4 <= m;
+            __m256i valid = _mm256_cmpgt_epi64(
+                _mm256_set1_epi64x(static_cast<int64_t>(m - j)), lanes);
+            __m256i x =
+                full ? _mm256_loadu_si256(
+                           reinterpret_cast<const __m256i *>(in + i))
+                     : _mm256_maskload_epi64(
+                           reinterpret_cast<const long long *>(in + i), valid);
+            __m256i abs = _mm256_and_si256(x, abs_mask);
+            __m256i is_nan = _mm256_cmpgt_epi64(abs, inf_bits);
+            __m256i is_zero = _mm256_cmpeq_epi64(abs, zero);
+            __m256i masks[NUM_CLASSES] = {
+                is_nan, _mm256_cmpeq_epi64(abs, inf_bits),
+                _mm256_andnot_si256(is_zero,
+                                    _mm256_cmpgt_epi64(min_normal, abs)),
+                is_zero, _mm256_cmpgt_epi64(zero, x)};
+            for (size_t c = 0; c < NUM_CLASSES; ++c)
+                words[c] |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(
+                                _mm256_and_si256(masks[c], valid))))
+                            << j;
+            if (out.canonicalize)
+                x = _mm256_blendv_epi8(x, canonical, is_nan);
+            if (out.keys) {
+                __m256i sign = _mm256_cmpgt_epi64(zero, x);
+                __m256i key = _mm256_xor_si256(x, _mm256_srli_epi64(sign, 1));
+                if (full)
+                    _mm256_storeu_si256(
+                        reinterpret_cast<__m256i *>(out.keys + i), key);
+                else
+                    _mm256_maskstore_epi64(
+                        reinterpret_cast<long long *>(out.keys + i), valid,
+                        key);
+            }
+            if (out.canonical) {
+                if (full)
+                    _mm256_storeu_si256(
+                        reinterpret_cast<__m256i *>(out.canonical + i), x);
+                else
+                    _mm256_maskstore_epi64(
+                        reinterpret_cast<long long *>(out.canonical + i),
+                        valid, x);
+            }
+        }
+        for (size_t c = 0; c < NUM_CLASSES; ++c)
+            if (out.classes[c])
+                out.classes[c][base / 64] = words[c];
+    }
+}
+
+// The reverse map, keys back to doubles.
+void bulk_key_doubles(const int64_t *keys, double *out, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i k =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        __m256i sign = _mm256_cmpgt_epi64(zero, k);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                            _mm256_xor_si256(k, _mm256_srli_epi64(sign, 1)));
+    }
+    for (; i < n; ++i)
+        out[i] = key_double(keys[i]);
+}
+
+// TBB drivers. Ranges are split on 64-element boundaries so that no
+// two tasks write the same bitmap word.
+void parallel_bulk_classify(const double *in, size_t n, const BulkOutput &out,
+                            size_t grain = 65536) {
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, (n + 63) / 64,
+                                   std::max<size_t>(1, grain / 64)),
+        [&](const auto &range) {
+            size_t begin = range.begin() * 64;
+            size_t end = std::min(n, range.end() * 64);
+            bulk_classify(in + begin, end - begin, out.offset(begin));
+        });
+}
+
+void parallel_bulk_key_doubles(const int64_t *keys, double *out, size_t n,
+                               size_t grain = 65536) {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n, grain),
+                      [&](const auto &range) {
+                          bulk_key_doubles(keys + range.begin(),
+                                           out + range.begin(), range.size());
+                      });
+}
+
+// All of the outputs of one bulk call, owned.
+struct BulkResult {
+    std::vector<int64_t> keys;
+    std::vector<double> canonical;
+    std::vector<uint64_t> classes[NUM_CLASSES];
+
+    explicit BulkResult(size_t n) : keys(n), canonical(n) {
+        for (auto &c : classes)
+            c.resize((n + 63) / 64);
+    }
+
+    BulkOutput output(bool canonicalize) {
+        BulkOutput out;
+        out.keys = keys.data();
+        out.canonical = canonical.data();
+        for (size_t c = 0; c < NUM_CLASSES; ++c)
+            out.classes[c] = classes[c].data();
+        out.canonicalize = canonicalize;
+        return out;
+    }
+};
+
+void expect_same(const BulkResult &expected, const BulkResult &observed) {
+    ASSERT_EQ(expected.keys, observed.keys);
+    for (size_t c = 0; c < NUM_CLASSES; ++c)
+        ASSERT_EQ(expected.classes[c], observed.classes[c]) << "class " << c;
+    for (size_t i = 0; i < expected.canonical.size(); ++i)
+        ASSERT_EQ(transmute<uint64_t>(expected.canonical[i]),
+                  transmute<uint64_t>(observed.canonical[i]))
+            << "index " << i;
+}
+
+// Every sign and exponent, with mantissas at the edges and some in
+// between, so every class and boundary is covered.
+std::vector<double> boundary_doubles() {
+    std::default_random_engine rng(1);
+    std::uniform_int_distribution<uint64_t> random_mantissa(
+        0, 0x000fffffffffffff);
+    std::vector<double> values;
+    for (uint64_t sign = 0; sign < 2; ++sign)
+        for (uint64_t exponent = 0; exponent < 2048; ++exponent) {
+            const uint64_t mantissas[] = {0,
+                                          1,
+                                          2,
+                                          0x0008000000000000,
+                                          0x0008000000000001,
+                                          0x000ffffffffffffe,
+                                          0x000fffffffffffff,
+                                          random_mantissa(rng),
+                                          random_mantissa(rng)};
+            for (uint64_t mantissa : mantissas)
+                values.push_back(transmute<double>(
+                    (sign << 63) | (exponent << 52) | mantissa));
+        }
+    return values;
+}
+
+TEST(IEEE754Notes, KeyRoundTrip) {
+    // Exhaustive over the top 20 bits (sign, exponent and 8 bits of
+    // mantissa), with three patterns for the remaining bits.
+    std::default_random_engine rng(2);
+    std::uniform_int_distribution<uint64_t> random_bits;
+    const size_t N = size_t(1) << 20;
+    std::vector<double> values(3 * N);
+    for (uint64_t high = 0; high < N; ++high) {
+        values[3 * high] = transmute<double>(high << 44);
+        values[3 * high + 1] = transmute<double>(high << 44 | 0xfffffffffff);
+        values[3 * high + 2] =
+            transmute<double>(high << 44 | (random_bits(rng) >> 20));
+    }
+    std::vector<int64_t> keys(values.size());
+    std::vector<double> round_trip(values.size());
+    BulkOutput out;
+    out.keys = keys.data();
+    parallel_bulk_classify(values.data(), values.size(), out);
+    parallel_bulk_key_doubles(keys.data(), round_trip.data(), keys.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        ASSERT_EQ(double_key(values[i]), keys[i]) << "index " << i;
+        ASSERT_EQ(transmute<uint64_t>(values[i]),
+                  transmute<uint64_t>(round_trip[i]))
+            << "index " << i;
+        ASSERT_EQ(transmute<uint64_t>(values[i]),
+                  transmute<uint64_t>(key_double(keys[i])))
+            << "index " << i;
+    }
+}
+
+TEST(IEEE754Notes, BulkClassify) {
+    std::vector<double> values = boundary_doubles();
+    std::shuffle(values.begin(), values.end(),
+                 std::default_random_engine(3));
+    // Every tail length, then the whole array.
+    std::vector<size_t> lengths;
+    for (size_t n = 0; n <= 130; ++n)
+        lengths.push_back(n);
+    lengths.push_back(values.size());
+    for (bool canonicalize : {false, true}) {
+        for (size_t n : lengths) {
+            BulkResult expected(n), observed(n);
+            bulk_classify_scalar(values.data(), n,
+                                 expected.output(canonicalize));
+            bulk_classify(values.data(), n, observed.output(canonicalize));
+            expect_same(expected, observed);
+        }
+        BulkResult expected(values.size());
+        bulk_classify_scalar(values.data(), values.size(),
+                             expected.output(canonicalize));
+        // Grains below 64 still split on bitmap words.
+        for (size_t grain : {1, 4096}) {
+            BulkResult parallel(values.size());
+            parallel_bulk_classify(values.data(), values.size(),
+                                   parallel.output(canonicalize), grain);
+            expect_same(expected, parallel);
+        }
+    }
+
+    // Canonicalized NaNs all share one key, which sorts above +inf.
+    double nans[] = {transmute<double>(uint64_t(0x7ff0000000000001)),
+                     transmute<double>(uint64_t(0xfff8000000000000)), NAN};
+    int64_t keys[3];
+    BulkOutput out;
+    out.keys = keys;
+    out.canonicalize = true;
+    bulk_classify(nans, 3, out);
+    for (int64_t key : keys) {
+        ASSERT_EQ(static_cast<int64_t>(CANONICAL_NAN), key);
+        ASSERT_LT(double_key(INFINITY), key);
+    }
+}
+
+// Set IEEE754_BENCH_ELEMENTS to run on larger inputs; each of the three
+// results below needs about 17 bytes per element on top of the input.
+TEST(IEEE754Notes, BulkClassifyBenchmark) {
+    size_t N = size_t(1) << 20;
+    if (const char *env = std::getenv("IEEE754_BENCH_ELEMENTS"))
+        N = std::strtoull(env, nullptr, 10);
+    std::default_random_engine rng(4);
+    std::uniform_int_distribution<uint64_t> random_bits;
+    std::vector<double> values(N);
+    std::generate(values.begin(), values.end(),
+                  [&] { return transmute<double>(random_bits(rng)); });
+    BulkResult expected(N), observed(N), parallel(N);
+    auto gb_per_s = [&](const auto &f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        return N * sizeof(double) / seconds / 1e9;
+    };
+    double scalar = gb_per_s([&] {
+        bulk_classify_scalar(values.data(), N, expected.output(true));
+    });
+    double avx2 = gb_per_s(
+        [&] { bulk_classify(values.data(), N, observed.output(true)); });
+    double tbb = gb_per_s([&] {
+        parallel_bulk_classify(values.data(), N, parallel.output(true));
+    });
+    expect_same(expected, observed);
+    expect_same(expected, parallel);
+    std::cout << "classify + key + canonicalize: scalar " << scalar
+              << " GB/s, AVX2 " << avx2 << " GB/s, AVX2 + TBB " << tbb
+              << " GB/s" << std::endl;
+}
+
 } // namespace
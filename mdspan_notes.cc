@@ -0,0 +1,628 @@
+// Notes on multidimensional views (a cut-down C++23 std::mdspan for
+// C++17; see [1]).
+//
+// gsl::span only covers contiguous 1-D ranges. An mdspan separates
+// three concerns:
+//
+//   - extents: the shape, where each extent is either a compile-time
+//     constant or dynamic_extent (stored at runtime). Static extents
+//     let the compiler see trip counts;
+//   - layout: a mapping from a multi-index to an offset (row-major,
+//     column-major, arbitrary strides, or tiles);
+//   - the data pointer, which is never owned.
+//
+// Slicing (submdspan) only adjusts the pointer, extents and strides,
+// so it never copies. for_each_run() walks a strided view as a
+// sequence of maximal contiguous runs (for_each_row() as one run per
+// unit-stride row) so that the loop handed each run is a plain pointer
+// loop that vectorizes.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+constexpr size_t dynamic_extent = std::numeric_limits<size_t>::max();
+
+template <size_t... Es> class extents {
+    static_assert(sizeof...(Es) > 0, "rank-0 views are not supported");
+    static constexpr size_t static_extents_[] = {Es...};
+
+  public:
+    static constexpr size_t rank() { return sizeof...(Es); }
+    static constexpr size_t rank_dynamic() {
+        return ((Es == dynamic_extent) + ... + 0);
+    }
+    static constexpr size_t static_extent(size_t r) {
+        return static_extents_[r];
+    }
+
+    // Only the dynamic extents are passed, in order.
+    template <typename... Is,
+              typename = std::enable_if_t<sizeof...(Is) == rank_dynamic()>>
+    constexpr explicit extents(Is... dynamic)
+        : dynamic_{static_cast<size_t>(dynamic)...} {}
+
+    // Every extent, static or not; the static ones are ignored.
+    constexpr explicit extents(const std::array<size_t, rank()> &all) {
+        for (size_t r = 0, d = 0; r < rank(); ++r)
+            if (static_extent(r) == dynamic_extent)
+                dynamic_[d++] = all[r];
+    }
+
+    constexpr size_t extent(size_t r) const {
+        if (static_extent(r) != dynamic_extent)
+            return static_extent(r);
+        size_t d = 0;
+        for (size_t k = 0; k < r; ++k)
+            d += static_extent(k) == dynamic_extent;
+        return dynamic_[d];
+    }
+
+    constexpr size_t size() const {
+        size_t n = 1;
+        for (size_t r = 0; r < rank(); ++r)
+            n *= extent(r);
+        return n;
+    }
+
+  private:
+    std::array<size_t, rank_dynamic()> dynamic_{};
+};
+
+template <size_t> constexpr size_t always_dynamic = dynamic_extent;
+
+template <size_t R, typename = std::make_index_sequence<R>>
+struct make_dextents;
+
+template <size_t R, size_t... Is>
+struct make_dextents<R, std::index_sequence<Is...>> {
+    using type = extents<always_dynamic<Is>...>;
+};
+
+template <size_t R> using dextents = typename make_dextents<R>::type;
+
+// Row-major: the last index is contiguous.
+struct layout_right {
+    template <typename E> class mapping {
+      public:
+        constexpr explicit mapping(const E &e) : extents_(e) {}
+        constexpr const E &extents() const { return extents_; }
+        constexpr size_t stride(size_t r) const {
+            size_t s = 1;
+            for (size_t k = r + 1; k < E::rank(); ++k)
+                s *= extents_.extent(k);
+            return s;
+        }
+        constexpr size_t required_span_size() const { return extents_.size(); }
+        template <typename... Is> constexpr size_t operator()(Is... is) const {
+            const size_t idx[] = {static_cast<size_t>(is)...};
+            size_t offset = 0;
+            for (size_t r = 0; r < E::rank(); ++r)
+                offset = offset * extents_.extent(r) + idx[r];
+            return offset;
+        }
+
+      private:
+        E extents_;
+    };
+};
+
+// Column-major: the first index is contiguous.
+struct layout_left {
+    template <typename E> class mapping {
+      public:
+        constexpr explicit mapping(const E &e) : extents_(e) {}
+        constexpr const E &extents() const { return extents_; }
+        constexpr size_t stride(size_t r) const {
+            size_t s = 1;
+            for (size_t k = 0; k < r; ++k)
+                s *= extents_.extent(k);
+            return s;
+        }
+        constexpr size_t required_span_size() const { return extents_.size(); }
+        template <typename... Is> constexpr size_t operator()(Is... is) const {
+            const size_t idx[] = {static_cast<size_t>(is)...};
+            size_t offset = 0;
+            for (size_t r = E::rank(); r-- > 0;)
+                offset = offset * extents_.extent(r) + idx[r];
+            return offset;
+        }
+
+      private:
+        E extents_;
+    };
+};
+
+// Arbitrary (non-negative) strides, in elements. This is what
+// submdspan() returns.
+struct layout_stride {
+    template <typename E> class mapping {
+      public:
+        constexpr mapping(const E &e, const std::array<size_t, E::rank()> &s)
+            : extents_(e), strides_(s) {}
+        constexpr const E &extents() const { return extents_; }
+        constexpr size_t stride(size_t r) const { return strides_[r]; }
+        constexpr size_t required_span_size() const {
+            if (extents_.size() == 0)
+                return 0;
+            size_t last = 0;
+            for (size_t r = 0; r < E::rank(); ++r)
+                last += (extents_.extent(r) - 1) * strides_[r];
+            return last + 1;
+        }
+        template <typename... Is> constexpr size_t operator()(Is... is) const {
+            const size_t idx[] = {static_cast<size_t>(is)...};
+            size_t offset = 0;
+            for (size_t r = 0; r < E::rank(); ++r)
+                offset += idx[r] * strides_[r];
+            return offset;
+        }
+
+      private:
+        E extents_;
+        std::array<size_t, E::rank()> strides_;
+    };
+};
+
+// 2-D matrix stored as row-major TR x TC tiles, with the tiles
+// themselves in row-major order. Partial tiles at the right and bottom
+// edges are padded to a full tile. There is no single stride per
+// dimension, so tiled views can't be sliced with submdspan(); use
+// mdspan::tile() instead.
+template <size_t TR, size_t TC> struct layout_tiled {
+    static constexpr size_t tile_rows = TR;
+    static constexpr size_t tile_cols = TC;
+
+    template <typename E> class mapping {
+        static_assert(E::rank() == 2, "tiled layout is 2-D only");
+
+      public:
+        constexpr explicit mapping(const E &e) : extents_(e) {}
+        constexpr const E &extents() const { return extents_; }
+        constexpr size_t tiles_per_row() const {
+            return (extents_.extent(1) + TC - 1) / TC;
+        }
+        constexpr size_t required_span_size() const {
+            return (extents_.extent(0) + TR - 1) / TR * tiles_per_row() * TR *
+                   TC;
+        }
+        // Offset of the first element of tile (ti, tj).
+        constexpr size_t tile_offset(size_t ti, size_t tj) const {
+            return (ti * tiles_per_row() + tj) * TR * TC;
+        }
+        constexpr size_t operator()(size_t i, size_t j) const {
+            return tile_offset(i / TR, j / TC) + (i % TR) * TC + j % TC;
+        }
+
+      private:
+        E extents_;
+    };
+};
+
+template <typename T, typename E, typename L = layout_right> class mdspan {
+  public:
+    using element_type = T;
+    using extents_type = E;
+    using layout_type = L;
+    using mapping_type = typename L::template mapping<E>;
+
+    constexpr mdspan(T *data, const mapping_type &m) : data_(data), map_(m) {}
+    constexpr mdspan(T *data, const E &e) : data_(data), map_(e) {}
+    template <typename... Is,
+              typename = std::enable_if_t<sizeof...(Is) == E::rank_dynamic()>>
+    constexpr explicit mdspan(T *data, Is... dynamic)
+        : data_(data), map_(E(dynamic...)) {}
+
+    static constexpr size_t rank() { return E::rank(); }
+    constexpr size_t extent(size_t r) const {
+        return map_.extents().extent(r);
+    }
+    constexpr size_t size() const { return map_.extents().size(); }
+    constexpr size_t stride(size_t r) const { return map_.stride(r); }
+    constexpr T *data() const { return data_; }
+    constexpr const mapping_type &mapping() const { return map_; }
+
+    template <typename... Is> constexpr T &operator()(Is... is) const {
+        static_assert(sizeof...(Is) == E::rank(), "wrong number of indices");
+        return data_[map_(is...)];
+    }
+
+    // Tile (ti, tj) of a tiled view as a contiguous row-major block.
+    constexpr auto tile(size_t ti, size_t tj) const {
+        return mdspan<T, extents<L::tile_rows, L::tile_cols>>(
+            data_ + map_.tile_offset(ti, tj));
+    }
+
+  private:
+    T *data_;
+    mapping_type map_;
+};
+
+// Slice specifiers for submdspan(). An integer index removes the
+// dimension; a half-open range or full_extent keeps it.
+struct full_extent_t {};
+constexpr full_extent_t full_extent{};
+
+struct slice_range {
+    size_t begin;
+    size_t end;
+};
+
+template <typename S>
+constexpr bool keeps_dimension =
+    !std::is_integral<std::remove_cv_t<std::remove_reference_t<S>>>::value;
+
+constexpr std::pair<size_t, size_t> slice_bounds(size_t index, size_t) {
+    return {index, index + 1};
+}
+constexpr std::pair<size_t, size_t> slice_bounds(slice_range s, size_t) {
+    return {s.begin, s.end};
+}
+constexpr std::pair<size_t, size_t> slice_bounds(full_extent_t,
+                                                 size_t extent) {
+    return {0, extent};
+}
+
+template <typename T, typename E, typename L, size_t... Rs,
+          typename... Slices>
+auto submdspan_impl(const mdspan<T, E, L> &m, std::index_sequence<Rs...>,
+                    Slices... slices) {
+    constexpr size_t R = (keeps_dimension<Slices> + ... + 0);
+    const std::pair<size_t, size_t> bounds[] = {
+        slice_bounds(slices, m.extent(Rs))...};
+    const bool keep[] = {keeps_dimension<Slices>...};
+    std::array<size_t, R> new_extents{};
+    std::array<size_t, R> new_strides{};
+    size_t offset = 0;
+    for (size_t r = 0, k = 0; r < E::rank(); ++r) {
+        offset += bounds[r].first * m.stride(r);
+        if (keep[r]) {
+            new_extents[k] = bounds[r].second - bounds[r].first;
+            new_strides[k] = m.stride(r);
+            ++k;
+        }
+    }
+    using result_extents = dextents<R>;
+    return mdspan<T, result_extents, layout_stride>(
+        m.data() + offset, typename layout_stride::template mapping<
+                               result_extents>(result_extents(new_extents),
+                                               new_strides));
+}
+
+// Zero-copy slice of a strided view. The result always has dynamic
+// extents and layout_stride.
+template <typename T, typename E, typename L, typename... Slices>
+auto submdspan(const mdspan<T, E, L> &m, Slices... slices) {
+    static_assert(sizeof...(Slices) == E::rank(), "one slice per dimension");
+    return submdspan_impl(m, std::make_index_sequence<E::rank()>(),
+                          slices...);
+}
+
+// Call f(run, length, index) for contiguous runs of a strided view,
+// where index is the multi-index of run[0]. The run dimension is the
+// last one with stride 1 (so layout_right iterates rows and
+// layout_left iterates columns); if there is none, every run has
+// length 1. With merge_outer, any other dimension whose stride equals
+// the length of the run so far is folded into the run too, so the
+// runs are maximal. Outer dimensions are visited with an odometer.
+template <typename T, typename E, typename L, typename F>
+void for_each_run_impl(const mdspan<T, E, L> &m, const F &f,
+                       bool merge_outer) {
+    constexpr size_t R = E::rank();
+    if (m.size() == 0)
+        return;
+    // Skip singleton dimensions: they have stride 1 in a row-major view
+    // but would give runs of length 1.
+    std::array<bool, R> in_run{};
+    size_t length = 1;
+    for (size_t r = R; r-- > 0;) {
+        if (m.stride(r) == 1 && m.extent(r) > 1) {
+            in_run[r] = true;
+            length = m.extent(r);
+            break;
+        }
+    }
+    for (bool merged = merge_outer; merged;) {
+        merged = false;
+        for (size_t r = 0; r < R; ++r) {
+            if (!in_run[r] && m.stride(r) == length) {
+                in_run[r] = true;
+                length *= m.extent(r);
+                merged = true;
+            }
+        }
+    }
+    std::array<size_t, R> index{};
+    for (;;) {
+        size_t offset = 0;
+        for (size_t r = 0; r < R; ++r)
+            offset += index[r] * m.stride(r);
+        f(m.data() + offset, length, index);
+        // Advance the odometer, skipping the dimensions the runs cover.
+        size_t r = R;
+        while (r-- > 0) {
+            if (in_run[r])
+                continue;
+            if (++index[r] < m.extent(r))
+                break;
+            index[r] = 0;
+        }
+        if (r == static_cast<size_t>(-1))
+            return;
+    }
+}
+
+// Every maximal contiguous run: a fully contiguous view is one run.
+template <typename T, typename E, typename L, typename F>
+void for_each_run(const mdspan<T, E, L> &m, const F &f) {
+    for_each_run_impl(m, f, true);
+}
+
+// One run per unit-stride row, for loops that need to know which row
+// they are on (e.g. column sums).
+template <typename T, typename E, typename L, typename F>
+void for_each_row(const mdspan<T, E, L> &m, const F &f) {
+    for_each_run_impl(m, f, false);
+}
+
+template <typename F> double elapsed_ms(const F &f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+TEST(MdspanNotes, Extents) {
+    using E = extents<3, dynamic_extent, 5>;
+    static_assert(E::rank() == 3);
+    static_assert(E::rank_dynamic() == 1);
+    static_assert(E::static_extent(0) == 3);
+    constexpr E e(4);
+    static_assert(e.extent(1) == 4);
+    static_assert(e.size() == 60);
+    static_assert(std::is_same<dextents<2>,
+                               extents<dynamic_extent, dynamic_extent>>::value);
+}
+
+TEST(MdspanNotes, Layouts) {
+    std::vector<int> buf(24);
+    std::iota(buf.begin(), buf.end(), 0);
+
+    mdspan<int, extents<2, 3, 4>> right(buf.data());
+    EXPECT_EQ(1 * 12 + 2 * 4 + 3, right(1, 2, 3));
+    EXPECT_EQ(12, right.stride(0));
+
+    mdspan<int, dextents<3>, layout_left> left(buf.data(), 2, 3, 4);
+    EXPECT_EQ(1 + 2 * 2 + 3 * 6, left(1, 2, 3));
+    EXPECT_EQ(6, left.stride(2));
+
+    // A 3x4 view of every other element.
+    mdspan<int, dextents<2>, layout_stride> strided(
+        buf.data(), {dextents<2>(3, 4), {8, 2}});
+    EXPECT_EQ(2 * 8 + 3 * 2, strided(2, 3));
+    EXPECT_EQ(23, strided.mapping().required_span_size());
+
+    // 5x6 matrix in 2x4 tiles: 3 x 2 tiles of 8 elements.
+    using Tiled = layout_tiled<2, 4>;
+    Tiled::mapping<dextents<2>> tiled(dextents<2>(5, 6));
+    EXPECT_EQ(48, tiled.required_span_size());
+    EXPECT_EQ(0, tiled(0, 0));
+    EXPECT_EQ(5, tiled(1, 1));
+    EXPECT_EQ(8, tiled(0, 4));
+    EXPECT_EQ(2 * 8 * 2 + 4 + 1, tiled(5, 1));
+}
+
+TEST(MdspanNotes, Submdspan) {
+    std::vector<int> buf(60);
+    std::iota(buf.begin(), buf.end(), 0);
+    mdspan<int, dextents<3>> m(buf.data(), 3, 4, 5);
+
+    // Column 2 of the middle matrix.
+    auto column = submdspan(m, 1, full_extent, 2);
+    static_assert(decltype(column)::rank() == 1);
+    EXPECT_EQ(&m(1, 0, 2), column.data());
+    EXPECT_EQ(4, column.extent(0));
+    EXPECT_EQ(5, column.stride(0));
+    for (size_t i = 0; i < 4; ++i)
+        EXPECT_EQ(m(1, i, 2), column(i));
+
+    // A 2x2x3 block, then a slice of the slice.
+    auto block = submdspan(m, slice_range{1, 3}, slice_range{2, 4},
+                           slice_range{1, 4});
+    EXPECT_EQ(&m(1, 2, 1), block.data());
+    EXPECT_EQ(3, block.extent(2));
+    EXPECT_EQ(m(2, 3, 3), block(1, 1, 2));
+    auto row = submdspan(block, 1, 0, full_extent);
+    EXPECT_EQ(&m(2, 2, 1), row.data());
+    EXPECT_EQ(3, row.extent(0));
+    EXPECT_EQ(1, row.stride(0));
+
+    // Writes through a view land in the original buffer.
+    column(3) = -1;
+    EXPECT_EQ(-1, buf[1 * 20 + 3 * 5 + 2]);
+}
+
+TEST(MdspanNotes, ForEachRun) {
+    std::vector<int> buf(120);
+    std::iota(buf.begin(), buf.end(), 0);
+    mdspan<int, dextents<3>> m(buf.data(), 3, 4, 5);
+
+    // Check that the runs cover exactly the elements of the view, each
+    // once, and return the number of runs.
+    auto count_runs = [](const auto &view, size_t expected_length,
+                         bool rows) {
+        std::vector<int *> covered, expected;
+        size_t runs = 0;
+        auto visit = [&](int *run, size_t length, const auto &index) {
+            EXPECT_EQ(expected_length, length);
+            EXPECT_EQ(&std::apply(view, index), run);
+            for (size_t k = 0; k < length; ++k)
+                covered.push_back(run + k);
+            ++runs;
+        };
+        if (rows)
+            for_each_row(view, visit);
+        else
+            for_each_run(view, visit);
+        for_each_row(view, [&](int *, size_t length, const auto &index) {
+            for (size_t k = 0; k < length; ++k) {
+                auto i = index;
+                i[view.rank() - 1] += k;
+                expected.push_back(&std::apply(view, i));
+            }
+        });
+        std::sort(covered.begin(), covered.end());
+        std::sort(expected.begin(), expected.end());
+        EXPECT_EQ(expected, covered);
+        EXPECT_EQ(view.size(), covered.size());
+        return runs;
+    };
+    // Fully contiguous: one run, or one per row.
+    EXPECT_EQ(1, count_runs(m, 60, false));
+    EXPECT_EQ(12, count_runs(m, 5, true));
+    // Whole rows of two matrices: each matrix is contiguous.
+    auto two_matrices = submdspan(m, slice_range{1, 3}, full_extent,
+                                  full_extent);
+    EXPECT_EQ(1, count_runs(two_matrices, 40, false));
+    // Rows [1, 3) of every matrix: rows merge, matrices don't.
+    mdspan<int, dextents<3>> padded(buf.data(), 3, 8, 5);
+    EXPECT_EQ(3, count_runs(submdspan(padded, full_extent, slice_range{1, 3},
+                                      full_extent),
+                            10, false));
+    // A trailing singleton dimension doesn't hide the unit-stride rows.
+    mdspan<int, dextents<3>> singleton(buf.data(), 3, 4, 1);
+    EXPECT_EQ(1, count_runs(singleton, 12, false));
+    EXPECT_EQ(3, count_runs(singleton, 4, true));
+    // Partial rows can't merge.
+    auto block = submdspan(m, slice_range{1, 3}, slice_range{0, 3},
+                           slice_range{1, 4});
+    EXPECT_EQ(6, count_runs(block, 3, false));
+    EXPECT_EQ(6, count_runs(block, 3, true));
+    // No unit stride: one element per run.
+    EXPECT_EQ(4, count_runs(submdspan(m, 0, full_extent, 0), 1, false));
+}
+
+// Column sums of a row-major matrix: through the view, for_each_row()
+// hands over one row at a time, and the inner loop is the same
+// sums[j] += row[j] loop a hand-written version uses.
+TEST(MdspanNotes, ColumnSumBenchmark) {
+    const size_t ROWS = 4096;
+    const size_t COLS = 1024;
+    const int PASSES = 8;
+    std::vector<double> buf(ROWS * COLS);
+    std::iota(buf.begin(), buf.end(), 0.0);
+
+    std::vector<double> expected(COLS);
+    double pointer_ms = elapsed_ms([&] {
+        for (int pass = 0; pass < PASSES; ++pass) {
+            std::fill(expected.begin(), expected.end(), 0.0);
+            const double *p = buf.data();
+            for (size_t i = 0; i < ROWS; ++i, p += COLS)
+                for (size_t j = 0; j < COLS; ++j)
+                    expected[j] += p[j];
+        }
+    });
+
+    mdspan<const double, dextents<2>> m(buf.data(), ROWS, COLS);
+    std::vector<double> sums(COLS);
+    double view_ms = elapsed_ms([&] {
+        for (int pass = 0; pass < PASSES; ++pass) {
+            std::fill(sums.begin(), sums.end(), 0.0);
+            double *s = sums.data();
+            for_each_row(m, [s](const double *row, size_t length,
+                                const auto &) {
+                for (size_t j = 0; j < length; ++j)
+                    s[j] += row[j];
+            });
+        }
+    });
+    ASSERT_EQ(expected, sums);
+
+    // Column-at-a-time through submdspan: strided, so each run has
+    // length 1. This is the access pattern to avoid.
+    std::vector<double> strided_sums(COLS);
+    double strided_ms = elapsed_ms([&] {
+        for (size_t j = 0; j < COLS; ++j) {
+            auto column = submdspan(m, full_extent, j);
+            double acc = 0;
+            for (size_t i = 0; i < ROWS; ++i)
+                acc += column(i);
+            strided_sums[j] = acc;
+        }
+    });
+    ASSERT_EQ(expected, strided_sums);
+
+    std::cout << "column sums: pointer " << pointer_ms / PASSES
+              << " ms, view runs " << view_ms / PASSES
+              << " ms, view columns " << strided_ms << " ms" << std::endl;
+}
+
+// Copy a row-major matrix into 8x64 tiles. The view version copies one
+// tile at a time from a submdspan of the source into tile(), with
+// std::copy over contiguous runs.
+TEST(MdspanNotes, BlockedCopyBenchmark) {
+    const size_t ROWS = 2048;
+    const size_t COLS = 2048;
+    const size_t TR = 8;
+    const size_t TC = 64;
+    const int PASSES = 8;
+    std::vector<uint32_t> src(ROWS * COLS);
+    std::iota(src.begin(), src.end(), 0);
+
+    std::vector<uint32_t> expected(ROWS * COLS);
+    double pointer_ms = elapsed_ms([&] {
+        for (int pass = 0; pass < PASSES; ++pass) {
+            uint32_t *dst = expected.data();
+            for (size_t ti = 0; ti < ROWS; ti += TR)
+                for (size_t tj = 0; tj < COLS; tj += TC)
+                    for (size_t i = ti; i < ti + TR; ++i, dst += TC)
+                        std::copy(&src[i * COLS + tj],
+                                  &src[i * COLS + tj + TC], dst);
+        }
+    });
+
+    mdspan<const uint32_t, dextents<2>> from(src.data(), ROWS, COLS);
+    std::vector<uint32_t> tiled(ROWS * COLS);
+    mdspan<uint32_t, dextents<2>, layout_tiled<TR, TC>> to(tiled.data(), ROWS,
+                                                           COLS);
+    ASSERT_EQ(tiled.size(), to.mapping().required_span_size());
+    double view_ms = elapsed_ms([&] {
+        for (int pass = 0; pass < PASSES; ++pass)
+            for (size_t ti = 0; ti < ROWS / TR; ++ti)
+                for (size_t tj = 0; tj < COLS / TC; ++tj) {
+                    auto tile = to.tile(ti, tj);
+                    auto block =
+                        submdspan(from, slice_range{ti * TR, ti * TR + TR},
+                                  slice_range{tj * TC, tj * TC + TC});
+                    for_each_row(block, [&](const uint32_t *run,
+                                            size_t length, const auto &i) {
+                        std::copy(run, run + length, &tile(i[0], 0));
+                    });
+                }
+    });
+    ASSERT_EQ(expected, tiled);
+    for (size_t i = 0; i < ROWS; i += 97)
+        for (size_t j = 0; j < COLS; j += 89)
+            ASSERT_EQ(from(i, j), to(i, j));
+
+    std::cout << "blocked copy: pointer " << pointer_ms / PASSES
+              << " ms, view " << view_ms / PASSES << " ms" << std::endl;
+}
+
+} // namespace
+
+// clang-format off
+// [1]: https://www.open-std.org/jtc1/sc22/wg21/docs/papers/2022/p0009r18.html
+// clang-format on
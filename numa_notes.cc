@@ -0,0 +1,310 @@
+// Notes on NUMA placement with TBB.
+//
+// Linux places a page on the node of the thread that first writes to
+// it ("first touch"). A std::vector<T>(n) is zero-filled by the
+// constructing thread, so on a multi-socket machine every page lands
+// on one node and workers on the other sockets read remote memory for
+// the lifetime of the vector. The fix is to allocate without
+// initializing and then touch the pages in parallel using the same
+// partitioning as the compute loop: one task_arena pinned to each
+// NUMA node owns a contiguous slice, and within the arena an
+// affinity_partitioner replays the same block-to-thread mapping on
+// every pass. See [1] and [2].
+//
+// The tests report where pages live (local or remote to the node that
+// processes them), not a count of remote accesses; a remote page is
+// read once per pass.
+//
+// Without tbbbind (or on a single-node machine) numa_nodes() returns
+// a single entry and everything below degrades to one ordinary arena.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/info.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+const size_t PAGE_BYTES = 4096;
+
+// One task_arena per NUMA node. Work submitted with run() is split
+// into one contiguous, page-aligned slice per node and each slice is
+// executed inside the arena for that node.
+class NumaArenas {
+  public:
+    NumaArenas() : nodes_(tbb::info::numa_nodes()) {
+        // task_arena is copyable (the copy is uninitialized), so
+        // reserve to avoid reallocating.
+        arenas_.reserve(nodes_.size());
+        for (auto node : nodes_)
+            arenas_.emplace_back(tbb::task_arena::constraints(node));
+    }
+
+    size_t size() const { return nodes_.size(); }
+
+    // NUMA node id backing arena i; -1 if the topology is unknown.
+    tbb::numa_node_id node(size_t i) const { return nodes_[i]; }
+
+    // The slice of [0, n) owned by arena i. Boundaries are rounded to
+    // whole pages of T so that no page is shared between nodes; that
+    // only holds if a page is a whole number of elements.
+    template <typename T>
+    tbb::blocked_range<size_t> slice(size_t i, size_t n) const {
+        static_assert(PAGE_BYTES % sizeof(T) == 0,
+                      "elements must tile a page exactly");
+        const size_t per_page = PAGE_BYTES / sizeof(T);
+        size_t num_pages = (n + per_page - 1) / per_page;
+        size_t begin = std::min(n, num_pages * i / size() * per_page);
+        size_t end = std::min(n, num_pages * (i + 1) / size() * per_page);
+        return tbb::blocked_range<size_t>(begin, end);
+    }
+
+    // Invoke f(i) inside arena i for every node concurrently and
+    // wait for all of them.
+    template <typename F> void run(const F &f) {
+        std::vector<tbb::task_group> groups(size());
+        for (size_t i = 0; i < size(); ++i)
+            arenas_[i].execute([&, i] { groups[i].run([&f, i] { f(i); }); });
+        for (size_t i = 0; i < size(); ++i)
+            arenas_[i].execute([&, i] { groups[i].wait(); });
+    }
+
+  private:
+    std::vector<tbb::numa_node_id> nodes_;
+    std::vector<tbb::task_arena> arenas_;
+};
+
+// Page-aligned, uninitialized storage for trivial T whose pages are
+// first touched by the arenas that will later process them. Every
+// parallel pass (including the first touch) goes through
+// parallel_for(), which reuses one affinity_partitioner per node, so
+// repeated passes see the same block-to-thread mapping.
+template <typename T> class NumaBuffer {
+    static_assert(std::is_trivial<T>::value,
+                  "first touch relies on untouched pages after allocation");
+
+  public:
+    NumaBuffer(NumaArenas &arenas, size_t size, size_t grain = 4096)
+        : arenas_(arenas), size_(size), grain_(grain),
+          data_(static_cast<T *>(std::aligned_alloc(
+              PAGE_BYTES, (size * sizeof(T) + PAGE_BYTES - 1) & -PAGE_BYTES))),
+          partitioners_(arenas.size()) {
+        if (!data_ && size != 0)
+            throw std::bad_alloc();
+        parallel_for([&](const auto &range) {
+            std::fill(begin() + range.begin(), begin() + range.end(), T());
+        });
+    }
+
+    T *begin() { return data_.get(); }
+    T *end() { return data_.get() + size_; }
+    const T *begin() const { return data_.get(); }
+    const T *end() const { return data_.get() + size_; }
+    T *data() { return data_.get(); }
+    size_t size() const { return size_; }
+    T &operator[](size_t i) { return data_[i]; }
+    const T &operator[](size_t i) const { return data_[i]; }
+
+    // Apply f to blocked_range<size_t> pieces of [0, size()), with
+    // every piece handled by the node that first touched it.
+    template <typename F> void parallel_for(const F &f) {
+        arenas_.run([&](size_t i) {
+            auto slice = arenas_.slice<T>(i, size_);
+            tbb::parallel_for(
+                tbb::blocked_range<size_t>(slice.begin(), slice.end(), grain_),
+                f, partitioners_[i]);
+        });
+    }
+
+    // Per-node parallel_reduce; the node results are then combined
+    // serially with the same join.
+    template <typename V, typename F, typename J>
+    V parallel_reduce(V identity, const F &f, const J &join) {
+        std::vector<V> partial(arenas_.size(), identity);
+        arenas_.run([&](size_t i) {
+            auto slice = arenas_.slice<T>(i, size_);
+            partial[i] = tbb::parallel_reduce(
+                tbb::blocked_range<size_t>(slice.begin(), slice.end(), grain_),
+                identity, f, join, partitioners_[i]);
+        });
+        return std::accumulate(partial.begin(), partial.end(), identity, join);
+    }
+
+  private:
+    NumaArenas &arenas_;
+    size_t size_;
+    size_t grain_;
+    // aligned_alloc rather than aligned new: unique_ptr<T[]> would
+    // release the memory with an unaligned delete[].
+    struct FreeDeleter {
+        void operator()(T *ptr) { free(static_cast<void *>(ptr)); }
+    };
+    std::unique_ptr<T[], FreeDeleter> data_;
+    std::vector<tbb::affinity_partitioner> partitioners_;
+};
+
+struct PagePlacement {
+    size_t local = 0;
+    size_t remote = 0;
+    size_t unknown = 0;
+};
+
+std::ostream &operator<<(std::ostream &stream, const PagePlacement &p) {
+    return stream << "local=" << p.local << " remote=" << p.remote
+                  << " unknown=" << p.unknown;
+}
+
+// Count the pages of [data, data + n) that live on the node owning
+// them. These are page counts, not access counts. Each page is counted
+// once, for the slice holding its first element in the range, so a page
+// straddling a slice boundary of an unaligned buffer isn't counted
+// twice. move_pages(2) with a null node list only queries placement; we
+// call it through syscall() to avoid depending on libnuma. Pages are
+// "unknown" if the query fails or the arena has no node affinity.
+template <typename T>
+PagePlacement page_placement(const NumaArenas &arenas, const T *data,
+                             size_t n) {
+    PagePlacement result;
+    if (n == 0)
+        return result;
+    const uintptr_t base = reinterpret_cast<uintptr_t>(data);
+    const uintptr_t last = reinterpret_cast<uintptr_t>(data + n);
+    std::vector<void *> pages;
+    std::vector<size_t> owners;
+    size_t owner = 0;
+    for (uintptr_t p = base & -PAGE_BYTES; p < last; p += PAGE_BYTES) {
+        size_t first = (std::max(p, base) - base) / sizeof(T);
+        while (arenas.slice<T>(owner, n).end() <= first)
+            ++owner;
+        pages.push_back(reinterpret_cast<void *>(p));
+        owners.push_back(owner);
+    }
+    std::vector<int> status(pages.size(), -1);
+    long rc = syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr,
+                      status.data(), 0);
+    for (size_t j = 0; j < pages.size(); ++j) {
+        tbb::numa_node_id node = arenas.node(owners[j]);
+        if (rc != 0 || status[j] < 0 || node < 0)
+            ++result.unknown;
+        else if (status[j] == node)
+            ++result.local;
+        else
+            ++result.remote;
+    }
+    return result;
+}
+
+TEST(NumaNotes, FirstTouchPlacement) {
+    const size_t NUM_ELEMENTS = 1048576;
+    NumaArenas arenas;
+    NumaBuffer<uint64_t> buffer(arenas, NUM_ELEMENTS);
+    ASSERT_EQ(0, reinterpret_cast<uintptr_t>(buffer.data()) & (PAGE_BYTES - 1));
+    ASSERT_TRUE(std::all_of(buffer.begin(), buffer.end(),
+                            [](uint64_t x) { return x == 0; }));
+
+    // The slices tile [0, n) without gaps.
+    size_t expected_begin = 0;
+    for (size_t i = 0; i < arenas.size(); ++i) {
+        auto slice = arenas.slice<uint64_t>(i, NUM_ELEMENTS);
+        ASSERT_EQ(expected_begin, slice.begin());
+        expected_begin = slice.end();
+    }
+    ASSERT_EQ(NUM_ELEMENTS, expected_begin);
+
+    PagePlacement placement =
+        page_placement(arenas, buffer.data(), buffer.size());
+    EXPECT_EQ(NUM_ELEMENTS * sizeof(uint64_t) / PAGE_BYTES,
+              placement.local + placement.remote + placement.unknown);
+    if (arenas.size() == 1) {
+        EXPECT_EQ(0, placement.remote);
+    }
+
+    // An unaligned range counts the pages it shares with a neighbouring
+    // slice once.
+    PagePlacement unaligned =
+        page_placement(arenas, buffer.data() + 1, buffer.size() - 2);
+    EXPECT_EQ(NUM_ELEMENTS * sizeof(uint64_t) / PAGE_BYTES,
+              unaligned.local + unaligned.remote + unaligned.unknown);
+    std::cout << arenas.size()
+              << " NUMA node(s); first-touch page placement: " << placement
+              << std::endl;
+}
+
+// Compare a serially zero-filled vector with a NumaBuffer for repeated
+// streaming passes. On a single node the two should be about equal.
+TEST(NumaNotes, RepeatedPassBandwidth) {
+    const size_t NUM_ELEMENTS = 1 << 23;
+    const int PASSES = 8;
+    NumaArenas arenas;
+
+    auto sum_range = [](const uint64_t *data) {
+        return [data](const tbb::blocked_range<size_t> &range,
+                      uint64_t acc) -> uint64_t {
+            return std::accumulate(data + range.begin(), data + range.end(),
+                                   acc);
+        };
+    };
+    auto gb_per_s = [&](auto elapsed) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        return PASSES * NUM_ELEMENTS * sizeof(uint64_t) / seconds / 1e9;
+    };
+
+    std::vector<uint64_t> serial(NUM_ELEMENTS);
+    std::iota(serial.begin(), serial.end(), 0);
+    tbb::affinity_partitioner serial_partitioner;
+    uint64_t serial_sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; ++pass)
+        serial_sum = tbb::parallel_reduce(
+            tbb::blocked_range<size_t>(0, NUM_ELEMENTS, 4096), uint64_t(0),
+            sum_range(serial.data()), std::plus<uint64_t>(),
+            serial_partitioner);
+    auto serial_elapsed = std::chrono::steady_clock::now() - start;
+
+    NumaBuffer<uint64_t> numa(arenas, NUM_ELEMENTS);
+    numa.parallel_for([&](const auto &range) {
+        std::iota(numa.begin() + range.begin(), numa.begin() + range.end(),
+                  range.begin());
+    });
+    uint64_t numa_sum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; ++pass)
+        numa_sum = numa.parallel_reduce(uint64_t(0), sum_range(numa.data()),
+                                        std::plus<uint64_t>());
+    auto numa_elapsed = std::chrono::steady_clock::now() - start;
+
+    ASSERT_EQ(NUM_ELEMENTS * (NUM_ELEMENTS - 1) / 2, serial_sum);
+    ASSERT_EQ(serial_sum, numa_sum);
+    std::cout << "serial first touch: pages "
+              << page_placement(arenas, serial.data(), serial.size()) << ", "
+              << gb_per_s(serial_elapsed) << " GB/s\n"
+              << "NUMA first touch:   pages "
+              << page_placement(arenas, numa.data(), numa.size()) << ", "
+              << gb_per_s(numa_elapsed) << " GB/s" << std::endl;
+}
+
+} // namespace
+
+// clang-format off
+// [1]: https://oneapi-src.github.io/oneTBB/main/tbb_userguide/Guiding_Task_Scheduler_Execution.html
+// [2]: https://man7.org/linux/man-pages/man2/move_pages.2.html
+// clang-format on
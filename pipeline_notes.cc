@@ -0,0 +1,484 @@
+// Notes on fusing passes with tbb::parallel_pipeline.
+//
+// Running convert, key and reduce as separate parallel passes over a
+// materialized vector streams the whole data set through memory once
+// per pass (and allocates an intermediate vector per pass). A
+// pipeline instead pushes cache-sized chunks through every stage while
+// they are still in L2. parallel_pipeline bounds the number of chunks
+// in flight by its token count, which is the back-pressure: the source
+// is not asked for another chunk until one leaves the pipeline. See
+// [1].
+//
+// Stages are element-wise maps. Each unfused stage is its own parallel
+// filter with its own buffer in the chunk; fuse() composes two maps
+// into one loop, so the intermediate values never leave registers.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/info.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_pipeline.h>
+#include <tbb/parallel_reduce.h>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+template <typename To, typename From> To transmute(From x) {
+    static_assert(sizeof(To) == sizeof(From), "size mismatch");
+    To y;
+    memcpy(&y, &x, sizeof(y));
+    return y;
+}
+
+uint64_t asr(uint64_t x, uint32_t shift) {
+    return static_cast<int64_t>(x) >> shift;
+}
+
+int64_t double_key(double d) {
+    uint64_t x = transmute<uint64_t>(d);
+    return x ^ (asr(x, 63) >> 1);
+}
+
+// An element-wise map from In to the result type of F.
+template <typename In, typename F> class Stage {
+  public:
+    using input_type = In;
+    using output_type = std::invoke_result_t<F, In>;
+
+    Stage(std::string name, F f) : name_(std::move(name)), f_(f) {}
+
+    const std::string &name() const { return name_; }
+    output_type operator()(In x) const { return f_(x); }
+    void apply(const In *in, output_type *out, size_t n) const {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = f_(in[i]);
+    }
+
+  private:
+    std::string name_;
+    F f_;
+};
+
+template <typename In, typename F>
+Stage<In, F> make_stage(std::string name, F f) {
+    return Stage<In, F>(std::move(name), f);
+}
+
+// Compose two stages into a single stage (one loop, no intermediate
+// buffer).
+template <typename S1, typename S2>
+auto fuse(const S1 &first, const S2 &second) {
+    static_assert(std::is_same<typename S1::output_type,
+                               typename S2::input_type>::value,
+                  "stage types don't line up");
+    return make_stage<typename S1::input_type>(
+        first.name() + "+" + second.name(),
+        [first, second](typename S1::input_type x) {
+            return second(first(x));
+        });
+}
+
+struct StageCounters {
+    std::atomic<uint64_t> chunks{0};
+    std::atomic<uint64_t> items{0};
+    std::atomic<uint64_t> busy_ns{0};
+
+    void record(size_t n, std::chrono::steady_clock::time_point start) {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        chunks.fetch_add(1, std::memory_order_relaxed);
+        items.fetch_add(n, std::memory_order_relaxed);
+        busy_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                .count(),
+            std::memory_order_relaxed);
+    }
+};
+
+// Per-stage throughput. busy_seconds is summed over all threads, so
+// items_per_second() is the throughput of one worker running the stage.
+struct StageReport {
+    std::string name;
+    uint64_t chunks;
+    uint64_t items;
+    double busy_seconds;
+
+    double items_per_second() const { return items / busy_seconds; }
+};
+
+std::ostream &operator<<(std::ostream &stream, const StageReport &r) {
+    return stream << r.name << ": " << r.chunks << " chunks, " << r.items
+                  << " items, " << r.busy_seconds * 1e3 << " ms busy, "
+                  << r.items_per_second() / 1e6 << " M items/s";
+}
+
+struct PipelineOptions {
+    // A chunk carries one buffer for the source and one per unfused
+    // stage, and all of them should stay in L2 while the chunk moves
+    // through the pipeline. By default (chunk_elements == 0) the chunk
+    // size is cache_bytes divided by the bytes per element across all
+    // of the buffers, so fusing stages buys larger chunks.
+    size_t chunk_elements = 0;
+    size_t cache_bytes = 512 * 1024;
+    size_t max_chunks_in_flight = 2 * tbb::info::default_concurrency();
+};
+
+template <typename Source, typename Reducer, size_t... Is,
+          typename... Stages>
+std::vector<StageReport>
+run_pipeline_impl(const PipelineOptions &options, Source &source,
+                  Reducer &reducer, std::index_sequence<Is...>,
+                  const std::tuple<const Stages &...> &stages) {
+    using Buffers = std::tuple<std::vector<typename Source::value_type>,
+                               std::vector<typename Stages::output_type>...>;
+    using Last = std::tuple_element_t<sizeof...(Stages), Buffers>;
+    static_assert(std::is_same<typename Last::value_type,
+                               typename Reducer::input_type>::value,
+                  "reducer input doesn't match the last stage");
+    using Partial = typename Reducer::partial_type;
+    struct Chunk {
+        size_t size = 0;
+        Buffers buffers;
+        Partial partial;
+    };
+
+    const size_t tokens = std::max<size_t>(1, options.max_chunks_in_flight);
+    const size_t bytes_per_element =
+        (sizeof(typename Source::value_type) + ... +
+         sizeof(typename Stages::output_type));
+    const size_t capacity =
+        options.chunk_elements != 0
+            ? options.chunk_elements
+            : std::max<size_t>(1, options.cache_bytes / bytes_per_element);
+    std::vector<Chunk> chunks(tokens);
+    for (auto &chunk : chunks)
+        std::apply([&](auto &...b) { (b.resize(capacity), ...); },
+                   chunk.buffers);
+    // Source, stages, reduce, combine.
+    std::vector<StageCounters> counters(sizeof...(Stages) + 3);
+    size_t next_chunk = 0;
+
+    auto source_filter = tbb::make_filter<void, Chunk *>(
+        tbb::filter_mode::serial_in_order, [&](tbb::flow_control &fc) {
+            auto start = std::chrono::steady_clock::now();
+            Chunk *chunk = &chunks[next_chunk++ % tokens];
+            chunk->size = source.read(std::get<0>(chunk->buffers).data(),
+                                      capacity);
+            if (chunk->size == 0) {
+                fc.stop();
+                return static_cast<Chunk *>(nullptr);
+            }
+            counters[0].record(chunk->size, start);
+            return chunk;
+        });
+    auto stage_filter = [&](auto index) {
+        constexpr size_t I = decltype(index)::value;
+        return tbb::make_filter<Chunk *, Chunk *>(
+            tbb::filter_mode::parallel, [&](Chunk *chunk) {
+                auto start = std::chrono::steady_clock::now();
+                std::get<I>(stages).apply(
+                    std::get<I>(chunk->buffers).data(),
+                    std::get<I + 1>(chunk->buffers).data(), chunk->size);
+                counters[I + 1].record(chunk->size, start);
+                return chunk;
+            });
+    };
+    auto reduce_filter = tbb::make_filter<Chunk *, Chunk *>(
+        tbb::filter_mode::parallel, [&](Chunk *chunk) {
+            auto start = std::chrono::steady_clock::now();
+            chunk->partial = reducer.reduce(
+                std::get<sizeof...(Stages)>(chunk->buffers).data(),
+                chunk->size);
+            counters[sizeof...(Stages) + 1].record(chunk->size, start);
+            return chunk;
+        });
+    auto combine_filter = tbb::make_filter<Chunk *, void>(
+        tbb::filter_mode::serial_in_order, [&](Chunk *chunk) {
+            auto start = std::chrono::steady_clock::now();
+            reducer.combine(chunk->partial);
+            counters[sizeof...(Stages) + 2].record(chunk->size, start);
+        });
+
+    tbb::parallel_pipeline(
+        tokens, (source_filter & ... &
+                 stage_filter(std::integral_constant<size_t, Is>())) &
+                    reduce_filter & combine_filter);
+
+    std::vector<std::string> names = {"source", std::get<Is>(stages).name()...,
+                                      "reduce", "combine"};
+    std::vector<StageReport> reports;
+    for (size_t i = 0; i < names.size(); ++i)
+        reports.push_back({names[i], counters[i].chunks, counters[i].items,
+                           counters[i].busy_ns * 1e-9});
+    return reports;
+}
+
+// Stream source → stages... → reducer.
+//
+// A Source has a value_type and size_t read(value_type *, size_t
+// capacity), returning 0 at the end of the stream. It is called
+// serially. A Reducer has an input_type matching the last stage, a
+// partial_type, a const method partial_type reduce(const input_type
+// *, size_t) that runs in parallel on each chunk, and combine(const
+// partial_type &), which runs serially in stream order (so a scan can
+// carry state between chunks).
+//
+// Chunks are preallocated, one per token. Because the first and last
+// filters are serial_in_order, chunks leave the pipeline in the order
+// they entered it, and chunk k can only get a token once chunk k -
+// max_chunks_in_flight has left, so chunk k can reuse that slot.
+template <typename Source, typename Reducer, typename... Stages>
+std::vector<StageReport> run_pipeline(const PipelineOptions &options,
+                                      Source &source, Reducer &reducer,
+                                      const Stages &...stages) {
+    return run_pipeline_impl(options, source, reducer,
+                             std::index_sequence_for<Stages...>(),
+                             std::tie(stages...));
+}
+
+// Reads from an array of raw counters, as a file or socket reader
+// would: copy out up to capacity values per call.
+struct ArraySource {
+    using value_type = uint64_t;
+
+    const uint64_t *data;
+    size_t size;
+    size_t position = 0;
+
+    size_t read(uint64_t *out, size_t capacity) {
+        size_t n = std::min(capacity, size - position);
+        std::copy_n(data + position, n, out);
+        position += n;
+        return n;
+    }
+};
+
+struct KeyStats {
+    uint64_t count = 0;
+    uint64_t checksum = 0; // wrapping sum of keys
+    int64_t min = std::numeric_limits<int64_t>::max();
+    int64_t max = std::numeric_limits<int64_t>::min();
+
+    static KeyStats of(const int64_t *keys, size_t n) {
+        KeyStats s;
+        s.count = n;
+        for (size_t i = 0; i < n; ++i) {
+            s.checksum += keys[i];
+            s.min = std::min(s.min, keys[i]);
+            s.max = std::max(s.max, keys[i]);
+        }
+        return s;
+    }
+
+    KeyStats &operator+=(const KeyStats &other) {
+        count += other.count;
+        checksum += other.checksum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        return *this;
+    }
+
+    bool operator==(const KeyStats &other) const {
+        return count == other.count && checksum == other.checksum &&
+               min == other.min && max == other.max;
+    }
+};
+
+struct KeyStatsReducer {
+    using input_type = int64_t;
+    using partial_type = KeyStats;
+
+    KeyStats result;
+
+    KeyStats reduce(const int64_t *keys, size_t n) const {
+        return KeyStats::of(keys, n);
+    }
+    void combine(const KeyStats &partial) { result += partial; }
+};
+
+auto convert_stage() {
+    return make_stage<uint64_t>(
+        "convert", [](uint64_t x) { return static_cast<double>(x); });
+}
+
+auto key_stage() {
+    return make_stage<double>("key", [](double d) { return double_key(d); });
+}
+
+// The same job as three separate parallel passes.
+KeyStats multi_pass(const std::vector<uint64_t> &raw) {
+    const size_t GRAIN = 32768;
+    std::vector<double> converted(raw.size());
+    std::vector<int64_t> keys(raw.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, raw.size(), GRAIN),
+                      [&](const auto &range) {
+                          for (size_t i = range.begin(); i < range.end(); ++i)
+                              converted[i] = static_cast<double>(raw[i]);
+                      });
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, raw.size(), GRAIN),
+                      [&](const auto &range) {
+                          for (size_t i = range.begin(); i < range.end(); ++i)
+                              keys[i] = double_key(converted[i]);
+                      });
+    return tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, raw.size(), GRAIN), KeyStats(),
+        [&](const auto &range, KeyStats acc) {
+            return acc += KeyStats::of(&keys[range.begin()], range.size());
+        },
+        [](KeyStats left, const KeyStats &right) { return left += right; });
+}
+
+std::vector<uint64_t> random_counters(size_t n) {
+    std::default_random_engine rng(1);
+    std::uniform_int_distribution<uint64_t> random_bits;
+    std::vector<uint64_t> raw(n);
+    std::generate(raw.begin(), raw.end(), [&] { return random_bits(rng); });
+    return raw;
+}
+
+TEST(PipelineNotes, FusedMatchesMultiPass) {
+    for (size_t n : {0, 1, 999, 32768, 100000}) {
+        std::vector<uint64_t> raw = random_counters(n);
+        KeyStats expected = multi_pass(raw);
+        PipelineOptions options;
+        options.chunk_elements = 1000; // chunk boundaries mid-input
+
+        ArraySource unfused_source{raw.data(), raw.size()};
+        KeyStatsReducer unfused;
+        auto reports = run_pipeline(options, unfused_source, unfused,
+                                    convert_stage(), key_stage());
+        ASSERT_TRUE(expected == unfused.result) << "n = " << n;
+        ASSERT_EQ(5, reports.size());
+        for (const auto &report : reports) {
+            EXPECT_EQ(n, report.items) << report.name;
+            EXPECT_EQ((n + 999) / 1000, report.chunks) << report.name;
+        }
+
+        ArraySource fused_source{raw.data(), raw.size()};
+        KeyStatsReducer fused;
+        reports = run_pipeline(options, fused_source, fused,
+                               fuse(convert_stage(), key_stage()));
+        ASSERT_TRUE(expected == fused.result) << "n = " << n;
+        ASSERT_EQ(4, reports.size());
+        EXPECT_EQ("convert+key", reports[1].name);
+    }
+}
+
+TEST(PipelineNotes, DefaultChunkSize) {
+    const size_t N = 100000;
+    std::vector<uint64_t> raw = random_counters(N);
+    PipelineOptions options;
+    options.cache_bytes = 24 * 1000;
+
+    // Three 8-byte buffers per unfused chunk, two per fused chunk.
+    ArraySource unfused_source{raw.data(), raw.size()};
+    KeyStatsReducer unfused;
+    auto reports = run_pipeline(options, unfused_source, unfused,
+                                convert_stage(), key_stage());
+    EXPECT_EQ(N / 1000, reports[0].chunks);
+
+    ArraySource fused_source{raw.data(), raw.size()};
+    KeyStatsReducer fused;
+    reports = run_pipeline(options, fused_source, fused,
+                           fuse(convert_stage(), key_stage()));
+    EXPECT_EQ((N + 1499) / 1500, reports[0].chunks);
+}
+
+// The reducer sees chunks in stream order, so it can also drive a scan.
+struct FirstKeyReducer {
+    using input_type = int64_t;
+    using partial_type = int64_t;
+
+    std::vector<int64_t> seen;
+
+    int64_t reduce(const int64_t *keys, size_t) const { return keys[0]; }
+    void combine(int64_t first) { seen.push_back(first); }
+};
+
+TEST(PipelineNotes, InOrderCombine) {
+    const size_t N = 100000;
+    std::vector<uint64_t> raw(N);
+    std::iota(raw.begin(), raw.end(), 0);
+
+    FirstKeyReducer reducer;
+    PipelineOptions options;
+    options.chunk_elements = 1024;
+    options.max_chunks_in_flight = 3;
+    ArraySource source{raw.data(), raw.size()};
+    run_pipeline(options, source, reducer,
+                 make_stage<uint64_t>("identity", [](uint64_t x) {
+                     return static_cast<int64_t>(x);
+                 }));
+    ASSERT_EQ((N + 1023) / 1024, reducer.seen.size());
+    for (size_t i = 0; i < reducer.seen.size(); ++i)
+        ASSERT_EQ(static_cast<int64_t>(i * 1024), reducer.seen[i]);
+}
+
+// Set PIPELINE_BENCH_ELEMENTS to run on multi-GB inputs (e.g. 536870912
+// for 4 GiB of raw counters; the multi-pass version needs three times
+// that).
+TEST(PipelineNotes, FusedVsMultiPassBenchmark) {
+    size_t n = 1 << 24;
+    if (const char *env = std::getenv("PIPELINE_BENCH_ELEMENTS"))
+        n = std::strtoull(env, nullptr, 10);
+    std::vector<uint64_t> raw = random_counters(n);
+    const double gigabytes = n * sizeof(uint64_t) / 1e9;
+    auto seconds_since = [](auto start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+            .count();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    KeyStats expected = multi_pass(raw);
+    double multi_pass_seconds = seconds_since(start);
+
+    PipelineOptions options;
+    ArraySource unfused_source{raw.data(), raw.size()};
+    KeyStatsReducer unfused;
+    start = std::chrono::steady_clock::now();
+    auto unfused_reports = run_pipeline(options, unfused_source, unfused,
+                                        convert_stage(), key_stage());
+    double unfused_seconds = seconds_since(start);
+
+    ArraySource fused_source{raw.data(), raw.size()};
+    KeyStatsReducer fused;
+    start = std::chrono::steady_clock::now();
+    auto fused_reports = run_pipeline(options, fused_source, fused,
+                                      fuse(convert_stage(), key_stage()));
+    double fused_seconds = seconds_since(start);
+
+    ASSERT_TRUE(expected == unfused.result);
+    ASSERT_TRUE(expected == fused.result);
+    std::cout << gigabytes << " GB of counters: multi-pass "
+              << gigabytes / multi_pass_seconds << " GB/s, pipeline "
+              << gigabytes / unfused_seconds << " GB/s, fused pipeline "
+              << gigabytes / fused_seconds << " GB/s\n";
+    for (const auto &report : unfused_reports)
+        std::cout << "  " << report << "\n";
+    for (const auto &report : fused_reports)
+        std::cout << "  fused " << report << "\n";
+    std::cout << std::flush;
+}
+
+} // namespace
+
+// clang-format off
+// [1]: https://oneapi-src.github.io/oneTBB/main/tbb_userguide/Working_on_the_Assembly_Line_pipeline.html
+// clang-format on
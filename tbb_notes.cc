@@ -6,8 +6,11 @@
 // https://www.threadingbuildingblocks.org/docs/help/reference/algorithms/parallel_scan_func.html
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cinttypes>
 #include <functional>
+#include <iostream>
 #include <numeric>
 #include <random>
 #include <vector>
@@ -17,6 +20,7 @@
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
 #include <tbb/parallel_scan.h>
+#include <tbb/task_arena.h>
 
 #include <gmp.h>
 
@@ -176,9 +180,10 @@ TEST(TBBNotes, ParallelPolynomialEvaluate) {
 
 // Use of a concurrent vector within a `parallel_for` to store
 // follow-on work.
-uint64_t add(uint64_t *rp, uint64_t *s1p, uint64_t *s2p, size_t num_limbs) {
+uint64_t add_concurrent_vector(uint64_t *rp, uint64_t *s1p, uint64_t *s2p,
+                               size_t num_limbs, size_t grain = 1024) {
     tbb::concurrent_vector<size_t> unresolved_carries;
-    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_limbs, 1024),
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_limbs, grain),
                       [&](const auto &range) {
                           if (mpn_add_n(rp + range.begin(), s1p + range.begin(),
                                         s2p + range.begin(), range.size()))
@@ -192,6 +197,78 @@ uint64_t add(uint64_t *rp, uint64_t *s1p, uint64_t *s2p, size_t num_limbs) {
     return rval;
 }
 
+// The concurrent vector is a shared, growing container: with small
+// grains every carrying block contends on it, and the entries come
+// back in whatever order the blocks finished. When the blocks are
+// fixed in advance, one bit per block is enough. Only blocks that
+// need follow-up work write, 64 blocks share a word, and the marked
+// blocks are visited in ascending order without allocating.
+class BlockBitmap {
+  public:
+    explicit BlockBitmap(size_t num_blocks)
+        : num_blocks_(num_blocks), words_((num_blocks + 63) / 64) {}
+
+    size_t size() const { return num_blocks_; }
+
+    void set(size_t block) {
+        words_[block / 64].fetch_or(uint64_t(1) << (block % 64),
+                                    std::memory_order_relaxed);
+    }
+
+    void clear() {
+        for (auto &word : words_)
+            word.store(0, std::memory_order_relaxed);
+    }
+
+    // Call f(block) for each marked block in ascending order. Only
+    // meaningful once the parallel map that sets bits has finished.
+    template <typename F> void for_each(const F &f) const {
+        for (size_t w = 0; w < words_.size(); ++w)
+            for (uint64_t bits = words_[w].load(std::memory_order_relaxed);
+                 bits != 0; bits &= bits - 1)
+                f(64 * w + __builtin_ctzll(bits));
+    }
+
+  private:
+    size_t num_blocks_;
+    std::vector<std::atomic<uint64_t>> words_;
+};
+
+// Parallel map over [0, n) in whole blocks of grain elements. f is
+// called on runs of consecutive blocks (whatever the partitioner hands
+// a task), and if it returns true the last block of the run is marked
+// in follow_up, so a bit always names a block boundary.
+template <typename F>
+void parallel_map_blocks(size_t n, size_t grain, BlockBitmap &follow_up,
+                         const F &f) {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, follow_up.size()),
+                      [&](const auto &blocks) {
+                          size_t end = std::min(n, blocks.end() * grain);
+                          if (f(tbb::blocked_range<size_t>(
+                                  blocks.begin() * grain, end)))
+                              follow_up.set(blocks.end() - 1);
+                      });
+}
+
+uint64_t add(uint64_t *rp, uint64_t *s1p, uint64_t *s2p, size_t num_limbs,
+             size_t grain = 1024) {
+    BlockBitmap unresolved_carries((num_limbs + grain - 1) / grain);
+    parallel_map_blocks(num_limbs, grain, unresolved_carries,
+                        [&](const auto &range) {
+                            return mpn_add_n(rp + range.begin(),
+                                             s1p + range.begin(),
+                                             s2p + range.begin(),
+                                             range.size()) != 0;
+                        });
+    uint64_t rval = 0;
+    unresolved_carries.for_each([&](size_t block) {
+        size_t it = std::min(num_limbs, (block + 1) * grain);
+        rval |=
+            (it == num_limbs) || mpn_add_1(rp + it, rp + it, num_limbs - it, 1);
+    });
+    return rval;
+}
+
 TEST(TBBNotes, ConcurrentVector) {
     const size_t NUM_LIMBS = 1048576;
     std::random_device urandom;
@@ -205,9 +282,93 @@ TEST(TBBNotes, ConcurrentVector) {
     std::generate(s2.begin(), s2.end(), [&] { return random_bits(rng); });
     uint64_t expected_carry =
         mpn_add_n(expected_r.data(), s1.data(), s2.data(), NUM_LIMBS);
-    uint64_t carry = add(r.data(), s1.data(), s2.data(), NUM_LIMBS);
+    uint64_t carry =
+        add_concurrent_vector(r.data(), s1.data(), s2.data(), NUM_LIMBS);
     ASSERT_EQ(expected_carry, carry);
     ASSERT_EQ(r, expected_r);
 }
 
+TEST(TBBNotes, BlockBitmap) {
+    // Bits set in any order come back in ascending order.
+    BlockBitmap marked(200);
+    std::vector<size_t> expected_blocks;
+    for (size_t b = 0; b < 200; b += 7)
+        expected_blocks.push_back(b);
+    tbb::parallel_for(size_t(0), expected_blocks.size(),
+                      [&](size_t i) { marked.set(expected_blocks[i]); });
+    std::vector<size_t> blocks;
+    marked.for_each([&](size_t block) { blocks.push_back(block); });
+    ASSERT_EQ(expected_blocks, blocks);
+    marked.clear();
+    marked.for_each([](size_t block) { FAIL() << "block " << block; });
+
+    // Random operands, then operands where almost every block carries.
+    const size_t NUM_LIMBS = 1048576 + 17;
+    std::random_device urandom;
+    std::default_random_engine rng(urandom());
+    std::uniform_int_distribution<uint64_t> random_bits;
+    std::vector<uint64_t> s1(NUM_LIMBS);
+    std::vector<uint64_t> s2(NUM_LIMBS);
+    std::vector<uint64_t> r(NUM_LIMBS);
+    std::vector<uint64_t> expected_r(NUM_LIMBS);
+    std::generate(s2.begin(), s2.end(), [&] { return random_bits(rng); });
+    for (bool saturated : {false, true}) {
+        std::generate(s1.begin(), s1.end(), [&] {
+            return saturated ? ~uint64_t(0) : random_bits(rng);
+        });
+        for (size_t grain : {1, 64, 1024}) {
+            uint64_t expected_carry =
+                mpn_add_n(expected_r.data(), s1.data(), s2.data(), NUM_LIMBS);
+            uint64_t carry =
+                add(r.data(), s1.data(), s2.data(), NUM_LIMBS, grain);
+            ASSERT_EQ(expected_carry, carry) << "grain " << grain;
+            ASSERT_EQ(r, expected_r) << "grain " << grain;
+        }
+    }
+}
+
+// Compare the two ways of collecting carries across grain sizes and
+// thread counts.
+TEST(TBBNotes, CarryCollectionBenchmark) {
+    const size_t NUM_LIMBS = 1048576;
+    const int REPETITIONS = 8;
+    std::random_device urandom;
+    std::default_random_engine rng(urandom());
+    std::uniform_int_distribution<uint64_t> random_bits;
+    std::vector<uint64_t> s1(NUM_LIMBS);
+    std::vector<uint64_t> s2(NUM_LIMBS);
+    std::vector<uint64_t> r(NUM_LIMBS);
+    std::generate(s1.begin(), s1.end(), [&] { return random_bits(rng); });
+    std::generate(s2.begin(), s2.end(), [&] { return random_bits(rng); });
+    auto time_ms = [&](auto add_fn, size_t grain) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < REPETITIONS; ++i)
+            add_fn(r.data(), s1.data(), s2.data(), NUM_LIMBS, grain);
+        return std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+                   .count() /
+               REPETITIONS;
+    };
+
+    // Powers of two, then the whole machine if that isn't one.
+    int max_threads = tbb::this_task_arena::max_concurrency();
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+    for (int threads : thread_counts) {
+        tbb::task_arena arena(threads);
+        for (size_t grain : {16, 64, 256, 1024, 8192}) {
+            double vector_ms, bitmap_ms;
+            arena.execute([&] {
+                vector_ms = time_ms(add_concurrent_vector, grain);
+                bitmap_ms = time_ms(add, grain);
+            });
+            std::cout << threads << " threads, grain " << grain
+                      << ": concurrent_vector " << vector_ms
+                      << " ms, bitmap " << bitmap_ms << " ms" << std::endl;
+        }
+    }
+}
+
 } // namespace